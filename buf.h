@@ -1,29 +1,56 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <vector>
 #include "db.h"
+#include "log.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
 // declarations for buffer pool hash table
 struct hashBucket {
-  File* file;        // pointer a file object (more on this below)
+  const File* file;  // pointer a file object (more on this below); NULL if slot is empty
   int pageNo;        // page number within a file
   int frameNo;       // frame number of page in the buffer pool
-  hashBucket* next;  // next node in the hash table
 };
 
-// hash table to keep track of pages in the buffer pool
+// number of independently latched partitions of the buffer hash table
+const int HTPARTITIONS = 16;
+
+// one partition of the hash table: a flat, power-of-two sized array of
+// buckets searched by linear probing
+struct hashPartition {
+  hashBucket* ht;     // actual hash table of this partition
+  unsigned int mask;  // number of buckets - 1
+  int count;          // number of buckets in use
+  std::mutex latch;   // latch protecting this partition
+};
+
+// hash table to keep track of pages in the buffer pool.  The table is
+// split into HTPARTITIONS open-addressing tables that are sized up front
+// and only reallocated if one of them fills past 3/4.  Callers must hold
+// the partition latch returned by latch() around insert, lookup and remove.
 class BufHashTbl {
  private:
-  int HTSIZE;
-  hashBucket** ht;                               // actual hash table
-  int hash(const File* file, const int pageNo);  // returns value between 0 and HTSIZE-1
+  hashPartition parts[HTPARTITIONS];
+  uint64_t hash(const File* file, const int pageNo) const;  // 64-bit mixed hash value
+  hashPartition& partition(const uint64_t h) { return parts[(h >> 32) % HTPARTITIONS]; }
+  void grow(hashPartition& part);  // double the number of buckets of a partition
 
  public:
   BufHashTbl(const int htSize);  // constructor
   ~BufHashTbl();                 // destructor
 
+  // returns the latch of the partition that (file,pageNo) hashes to
+  std::mutex& latch(const File* file, const int pageNo) { return partition(hash(file, pageNo)).latch; }
+
   // insert entry into hash table mapping (file,pageNo) to frameNo;
   // returns 0 if OK, HASHTBLERROR if an error occurred
   Status insert(const File* file, const int pageNo, const int frameNo);
@@ -36,22 +63,36 @@ class BufHashTbl {
   // delete entry (file,pageNo) from hash table. REturn OK if page was
   // found.  Else return HASHTBLERROR
   Status remove(const File* file, const int pageNo);
+
+  // for diagnostics: hist[i] is set to the number of entries found i
+  // probes away from their home bucket (the last element counts the rest)
+  void probeHistogram(int hist[], const int histSize);
 };
 
 class BufMgr;  // forward declaration of BufMgr class
 
-// class for maintaining information about buffer pool frames
+// class for maintaining information about buffer pool frames.
+// file, pageNo and valid only change while the frame latch is held
+// exclusively and the owning hash partition is latched; pinCnt is only
+// incremented under the hash partition latch.  A frame whose page is being
+// read from disk stays exclusively latched until the read completes.
 class BufDesc {
   friend class BufMgr;
 
  private:
-  File* file;   // pointer to file object
-  int pageNo;   // page within file
-  int frameNo;  // frame # of frame
-  int pinCnt;   // number of times this page has been pinned
-  bool dirty;   // true if dirty;  false otherwise
-  bool valid;   // true if page is valid
-  bool refbit;  // has this buffer frame been reference recently
+  File* file;                // pointer to file object
+  int pageNo;                // page within file
+  int frameNo;               // frame # of frame
+  std::atomic<int> pinCnt;   // number of times this page has been pinned
+  std::atomic<bool> dirty;   // true if dirty;  false otherwise
+  std::atomic<bool> valid;   // true if page is valid
+  std::atomic<bool> readAhead;  // read ahead and not referenced yet
+  std::atomic<uint64_t> pageLSN;  // end of the last log record of the page
+  std::atomic<uint64_t> recLSN;   // first log record of the page not written yet, NOLSN if none
+  std::atomic<bool> logPending;   // changed by a pin, to be logged when the last pin goes
+  std::shared_mutex latch;   // shared/exclusive latch on the frame
+  int prevFrame, nextFrame;  // neighbours in the frame list of file, -1 at the ends
+  bool listed;               // frame is on the frame list of file
 
   void Clear() {  // initialize buffer frame for a new user
     pinCnt = 0;
@@ -59,6 +100,10 @@ class BufDesc {
     pageNo = -1;
     dirty = false;
     valid = false;
+    readAhead = false;
+    pageLSN = 0;
+    recLSN = NOLSN;
+    logPending = false;
   };
 
   void Set(File* filePtr, int pageNum) {
@@ -67,45 +112,243 @@ class BufDesc {
     pinCnt = 1;
     dirty = false;
     valid = true;
-    refbit = true;
+    readAhead = false;
+    pageLSN = 0;
+    recLSN = NOLSN;
+    logPending = false;
   }
 
-  BufDesc() { Clear(); }
+  BufDesc() {
+    Clear();
+    prevFrame = nextFrame = -1;
+    listed = false;
+  }
 };
 
-struct BufStats {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+// page replacement policies the buffer manager can be built with
+enum BufPolicyKind { CLOCK, LRUK, TWOQ, ARC, CLOCKPRO };
+
+// Interface of a page replacement policy.  The buffer manager tells the
+// policy about every page it loads into a frame, every hit and every frame
+// it empties for other reasons (flush, dispose, failed read); the policy
+// picks the frames to evict.  Frames that hold no page are reused by the
+// buffer manager itself and never offered to the policy.  Policies do
+// their own latching; access() may be called concurrently with anything.
+class BufPolicy {
+ public:
+  virtual ~BufPolicy() {}
+
+  // page (file,pageNo) has been placed into frame frameNo
+  virtual void load(const int frameNo, const File* file, const int pageNo) = 0;
+
+  // the page in frame frameNo has been referenced
+  virtual void access(const int frameNo) = 0;
 
-  void clear() { accesses = diskreads = diskwrites = 0; }
+  // frame frameNo no longer holds a page; forget it without a trace
+  virtual void remove(const int frameNo) = 0;
+
+  // pick a victim among the loaded frames for which claim(frameNo)
+  // returns true, drop it from the policy and return it; claim() latches
+  // the frame for the caller.  Returns -1 if no frame can be claimed.
+  virtual int victim(const std::function<bool(int)>& claim) = 0;
+
+  // the frame victim() returned keeps its page after all; put it back as
+  // it was before, without counting an access or a return from the ghosts
+  virtual void reinstate(const int frameNo) = 0;
+
+  // fill frames with up to n loaded frames, those expected to be evicted
+  // soonest first; used to clean frames ahead of eviction
+  virtual void upcoming(std::vector<int>& frames, const int n) = 0;
+
+  virtual const char* name() const = 0;
+
+  // returns a new policy of the given kind for a pool of numBufs frames
+  static BufPolicy* create(const BufPolicyKind kind, const int numBufs);
+};
+
+// Latencies on a log2 scale: bucket 0 counts latencies below 1 ns,
+// bucket i those in [2^(i-1), 2^i) ns, the last one everything longer.
+struct LatencyHistogram {
+  static const int BUCKETS = 40;  // up to about 9 minutes
+  std::atomic<long> counts[BUCKETS];
+
+  void record(const long ns) {
+    int i = ns <= 0 ? 0 : 64 - __builtin_clzl(ns);
+    counts[i < BUCKETS ? i : BUCKETS - 1]++;
+  }
+  long count() const {
+    long n = 0;
+    for (int i = 0; i < BUCKETS; i++) n += counts[i];
+    return n;
+  }
+  // upper bound in ns of the bucket holding the pct-th percentile, 0 if empty
+  long percentile(const double pct) const {
+    long n = count(), seen = 0;
+    for (int i = 0; i < BUCKETS && n > 0; i++)
+      if ((seen += counts[i]) >= pct / 100 * n) return 1L << i;
+    return 0;
+  }
+  void clear() {
+    for (int i = 0; i < BUCKETS; i++) counts[i] = 0;
+  }
+
+  LatencyHistogram() { clear(); }
+};
+
+// what the buffer manager did for one file
+struct BufFileStats {
+  std::atomic<long> hits;            // readPage found the page in the pool
+  std::atomic<long> misses;          // readPage had to read the page from disk
+  std::atomic<long> evictions;       // pages evicted to make room
+  std::atomic<long> dirtyevictions;  // evictions that had to write the page first
+  std::atomic<long> allocs;          // pages allocated through allocPage
+  std::atomic<long> disposes;        // pages disposed of through disposePage
+  std::atomic<long> flushes;         // dirty pages written by flushFile
+
+  void clear() { hits = misses = evictions = dirtyevictions = allocs = disposes = flushes = 0; }
+
+  BufFileStats() { clear(); }
+};
+
+struct BufStats : BufFileStats {
+  std::atomic<long> accesses;        // Total number of accesses to buffer pool
+  std::atomic<long> diskreads;       // Number of pages read from disk (including allocs)
+  std::atomic<long> diskwrites;      // Number of pages written back to disk
+  std::atomic<long> cleanerwrites;   // Pages written by the background writer
+  std::atomic<long> readaheads;      // Pages read from disk ahead of a sequential reader
+  LatencyHistogram missLatency;      // readPage calls that read from disk
+  LatencyHistogram writeLatency;     // every write call of the buffer manager
+
+  double hitRatio() const { return accesses ? (double)hits / accesses : 0; }
+
+  void clear() {
+    BufFileStats::clear();
+    accesses = diskreads = diskwrites = cleanerwrites = readaheads = 0;
+    missLatency.clear();
+    writeLatency.clear();
+  }
 
   BufStats() { clear(); }
 };
 
+// read-ahead windows, in pages
+const int RAMINWINDOW = 4;       // window of a newly detected sequential reader
+const int RADEFAULTWINDOW = 32;  // default limit of the window
+
+// most frames latched at once to write out a batch of pages; the
+// background writer also stays below a quarter of the pool
+const unsigned WRITEBATCH = 32;
+
+// per-file state kept by the buffer manager; owned by the File object
+struct BufFileState {
+  std::mutex latch;  // protects the read-ahead state
+  int lastPage;      // page most recently requested through readPage
+  int window;        // read-ahead window in pages, 0 if not reading sequentially
+  int raEnd;         // first page past those already read ahead
+  BufFileStats stats;  // counters of this file
+  std::mutex framesLatch;  // protects the frame list
+  int firstFrame;          // head of the list of frames holding pages of the file, -1 if none
+  int numFrames;           // length of the frame list
+
+  BufFileState() {
+    lastPage = -1;
+    window = 0;
+    raEnd = 0;
+    firstFrame = -1;
+    numFrames = 0;
+  }
+};
+
+class PageHandle;
+class IoRing;
+
+// a run of consecutive pages of one file, held by consecutive entries of
+// a list of latched frames, to be read or written with one request
+struct IoRun {
+  int first;      // index of the first frame of the run in the list
+  int n;          // number of pages
+  int done;       // pages transferred
+  Status status;  // outcome
+};
+
+// The buffer manager may be shared by any number of threads.
 class BufMgr {
+  friend class PageHandle;
+
  private:
-  unsigned int clockHand;
   int numBufs;            // Number of pages in buffer pool
   BufHashTbl* hashTable;  // hash table mapping (File, page) to frame
   BufDesc* bufTable;      // vector of status info, 1 per page
   BufStats bufStats;      // buffer pool statistics
+  BufPolicy* policy;      // page replacement policy
+  std::vector<int> freeList;  // frames holding no page
+  std::mutex freeLatch;       // latch protecting freeList
 
-  const Status allocBuf(int& frame);  // allocate a free frame.
+  std::atomic<int> numDirty;          // number of dirty frames
+  std::thread* writer;                // background writer, NULL if not running
+  std::atomic<int> writerCleanPct;    // writer target: percentage of clean frames
+  std::atomic<int> writerRate;        // writer limit: pages written per second
+  bool writerStop;                    // tells the writer to exit
+  std::mutex writerLatch;             // protects writerStop
+  std::condition_variable writerWake; // wakes the writer early
+  std::atomic<int> raMaxWindow;       // largest read-ahead window, 0 disables read-ahead
+  std::atomic<int> raFrames;          // frames latched by read-ahead in progress
+  size_t poolMapped;                  // length of the pool mapping, 0 if on the heap
+  IoRing* ring;                       // io_uring for batched I/O, NULL for positional I/O
+  bool poolHuge;                      // pool is backed by explicit huge pages
+  LogMgr* log;                        // write-ahead log, NULL if none
+
+  const Status allocBuf(int& frame);  // allocate a free frame, returned exclusively latched
   const void releaseBuf(int frame);   // return unused frame to end of list
-  void advanceClock() { clockHand = (clockHand + 1) % numBufs; }
+  bool claimBuf(int frame);           // latch frame exclusively if it is unpinned
+  void markDirty(BufDesc* desc) { if (!desc->dirty.exchange(true)) numDirty++; }
+  void markClean(BufDesc* desc) {
+    desc->recLSN = NOLSN;
+    if (desc->dirty.exchange(false)) numDirty--;
+  }
+  bool claimDirty(int frame);         // latch frame if it is dirty and unpinned
+  void cleanBufs(std::vector<int>& frames);  // write out and release claimed frames
+  void writerLoop();                  // body of the background writer
+  void readAhead(File* file, const int pageNo);  // note access, prefetch if sequential
+  void prefetch(File* file, const int first, const int n);  // read pages not buffered yet
+  // unpin the page a handle pinned in frame, without a lookup
+  const Status unPinFrame(const int frame, const File* file, const int pageNo, const bool dirty);
+  const Status logUnpin(const int frame, const bool dirty);  // log the page if due; partition latch held
+  const Status logWrites(const std::vector<int>& frames);  // flush the log ahead of writing frames
+  const Status readMapped(File* file, const int pageNo, Page*& page);  // pin a mapped page
+  const Status writeBuf(int frame);   // write out the page in a latched frame, timed
+  // write out the pages in latched frames, sorted and coalesced into runs
+  const Status writeBufs(std::vector<int>& frames, int& written);
+  // read or write runs of pages, all in flight together if the io_uring is used
+  void transferRuns(const bool write, const std::vector<int>& frames, std::vector<IoRun>& runs);
+  void linkFrame(int frame);          // add frame to the frame list of its file
+  void unlinkFrame(int frame);        // drop frame from the frame list of its file, if on it
 
  public:
-  Page* bufPool;  // actual buffer pool
+  Page* bufPool;  // actual buffer pool, aligned to a huge page
 
-  BufMgr(const int bufs);
+  BufMgr(const int bufs, const BufPolicyKind policyKind = CLOCK);
   ~BufMgr();
 
   const Status readPage(File* file, const int PageNo, Page*& page);
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
-  const Status allocPage(File* file, int& PageNo, Page*& page);
-  // allocates a new, empty page
+  const Status allocPage(File* file, int& PageNo, Page*& page, const int near = -1);
+  // allocates a new, empty page; if near is given, the free page closest to it
+
+  // the same, pinning the page into a handle that unpins it when it is
+  // destroyed or reassigned; a page the handle held before is unpinned first
+  const Status readPage(File* file, const int PageNo, PageHandle& handle);
+  const Status allocPage(File* file, int& PageNo, PageHandle& handle, const int near = -1);
+
+  // allocates n consecutive new pages, the first of which is returned in
+  // firstPageNo, and pins them into pages[0..n-1]; BUFFEREXCEEDED if the
+  // pool cannot hold all of them, in which case nothing is allocated
+  const Status allocPages(File* file, const int n, int& firstPageNo, Page* pages[]);
+
   const Status flushFile(const File* file);  // writing out all dirty pages of the file
+  // forget every page of a file that goes away without a successful
+  // close, pinned or dirty; pins still held are released into nothing
+  void dropFile(const File* file);
   const Status disposePage(File* file, const int PageNo);  // dispose of page in file
   void printSelf();
 
@@ -114,6 +357,116 @@ class BufMgr {
     return bufStats;
   }
   const void clearBufStats() { bufStats.clear(); }
+  const BufFileStats& getFileStats(const File* file) const  // counters of one file
+  {
+    return file->bufState->stats;
+  }
+  void printStats();  // print the statistics of the whole pool
+
+  // start a background thread that writes out dirty, unpinned pages in the
+  // order the replacement policy will evict them, so that eviction finds
+  // clean frames.  It keeps at least cleanPct percent of the frames clean
+  // and writes at most pagesPerSec pages per second.  If the writer is
+  // already running its settings are changed.
+  void startWriter(const int cleanPct, const int pagesPerSec);
+  void stopWriter();  // stop the background writer, if running
+
+  // readPage detects callers walking a file in page order and reads the
+  // pages after the requested one into the pool ahead of time, with one
+  // system call per run.  The window starts at RAMINWINDOW pages and
+  // doubles while the access stays sequential, up to maxPages (and never
+  // more than a quarter of the pool).  0 turns read-ahead off.
+  void setReadAhead(const int maxPages) { raMaxWindow = std::max(0, std::min(maxPages, numBufs / 4)); }
+
+  // Batches of reads and writes (read-ahead, flushFile, the background
+  // writer) are submitted through an io_uring of the given depth shared
+  // by all threads, so that they are in flight together; single pages
+  // are still read and written with positional I/O.  0 goes back to
+  // positional I/O for everything.  UNIXERR if the kernel has no
+  // io_uring.  Not to be called while other threads use the pool.
+  const Status useIoRing(const unsigned depth);
+  bool usesIoRing() const { return ring != NULL; }
+
+  // With a log attached every page unpinned dirty is logged once its last
+  // pin goes, and the log is flushed up to a page's last record before
+  // the page is written.  NULL detaches the log.  Not to be called while
+  // other threads use the pool; the log must outlive the buffer manager.
+  void setLog(LogMgr* logMgr) { log = logMgr; }
+
+  // write out every dirty page that is not pinned; oldestLSN is set to
+  // the first log record of the pages that are still dirty, NOLSN if none
+  const Status writeDirty(uint64_t& oldestLSN);
+
+  const char* getPolicyName() const { return policy->name(); }
+  bool hasHugePool() const { return poolHuge; }  // pool uses explicit huge pages
+};
+
+// A pin on one buffered page.  The handle remembers the frame, so
+// unpinning needs no hash lookup, and it unpins in its destructor, so a
+// pin cannot leak on an early return.  Handles can be moved, not copied.
+class PageHandle {
+  friend class BufMgr;
+
+ private:
+  BufMgr* bufMgr;  // buffer manager holding the pin, NULL if empty
+  int frameNo;     // frame of the pinned page
+  int pageNo;      // page within file
+  bool dirty;      // unpin as dirty
+  File* file;      // file of the pinned page
+  File* mapped;    // file of a page pinned in its mapping instead of a frame
+
+  void set(BufMgr* mgr, const int frame, const int page, File* filePtr = NULL, const bool map = false) {
+    bufMgr = mgr;
+    frameNo = frame;
+    pageNo = page;
+    dirty = false;
+    file = filePtr;
+    mapped = map ? filePtr : NULL;
+  }
+
+ public:
+  PageHandle() { set(NULL, -1, -1); }
+  PageHandle(PageHandle&& other) {
+    set(other.bufMgr, other.frameNo, other.pageNo, other.file, other.mapped != NULL);
+    dirty = other.dirty;
+    other.set(NULL, -1, -1);
+  }
+  PageHandle& operator=(PageHandle&& other) {
+    if (this != &other) {
+      release();
+      set(other.bufMgr, other.frameNo, other.pageNo, other.file, other.mapped != NULL);
+      dirty = other.dirty;
+      other.set(NULL, -1, -1);
+    }
+    return *this;
+  }
+  PageHandle(const PageHandle&) = delete;
+  PageHandle& operator=(const PageHandle&) = delete;
+  ~PageHandle() { release(); }
+
+  // unpin the page now; the handle is empty afterwards
+  const Status release() {
+    if (!bufMgr) return OK;
+    Status status = mapped ? bufMgr->unPinPage(mapped, pageNo, dirty) : bufMgr->unPinFrame(frameNo, file, pageNo, dirty);
+    set(NULL, -1, -1);
+    return status;
+  }
+
+  // the page is written back when evicted; a mapped page is read-only
+  const Status markDirty() {
+    if (mapped) return FILEREADONLY;
+    dirty = true;
+    return OK;
+  }
+
+  explicit operator bool() const { return bufMgr != NULL; }
+  Page* get() const {
+    if (!bufMgr) return NULL;
+    return mapped ? mapped->mappedPage(pageNo) : bufMgr->bufPool + frameNo;
+  }
+  Page* operator->() const { return get(); }
+  Page& operator*() const { return *get(); }
+  int getPageNo() const { return pageNo; }
 };
 
 #endif
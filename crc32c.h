@@ -0,0 +1,18 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli) of length bytes at data, continuing from crc; the
+// SSE4.2 crc32 instruction is used where the processor has it, a table
+// otherwise.  The choice is made once, when the program starts.
+uint32_t crc32c(const void* data, const size_t length, const uint32_t crc = 0);
+
+// true if crc32c runs on the SSE4.2 instruction
+bool crc32cHardware();
+
+// the table version, always available, for comparison
+uint32_t crc32cTable(const void* data, const size_t length, const uint32_t crc = 0);
+
+#endif
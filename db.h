@@ -2,8 +2,14 @@
 #define DB_H
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <vector>
 #include "error.h"
+#include "page.h"
 #include <string.h>
 using namespace std;
 
@@ -14,20 +20,82 @@ using namespace std;
 
 // forward class definition for db
 class DB;
+class LogMgr;
+struct BufFileState;
+
+// Free pages are tracked in bitmap pages, one bit per page of the file,
+// set if the page is free.  The header page lists the bitmap pages, which
+// are allocated like any other page when a disposed page first needs
+// one.  Files written before the bitmaps had a list of free pages
+// threaded through nextFree instead; it is converted on open.
+
+const int BITSPERMAP = PAGESIZE * 8;                   // pages covered by one bitmap page
+const int MAXFREEMAPS = PAGESIZE / sizeof(int) - 8;    // bitmap pages a header can list
+
+// structure of DB (header) page
+
+typedef struct {
+  int nextFree;   // page # of next page on legacy free list, -1 if none
+  int firstPage;  // page # of first page in file
+  int numPages;   // total # of pages in file
+  int numFree;    // # of free pages in the bitmaps
+  int numMaps;    // # of bitmap pages
+  int mapPages[MAXFREEMAPS];  // page # of each bitmap page
+} DBPage;
+
+// Files grow in extents: space for as many pages as the file already
+// has, at least EXTENTMIN pages and at most 16 MB worth of them, is
+// reserved at a time ahead of the pages actually allocated.
+const int EXTENTMIN = 16;
+const int EXTENTMAX = (16 << 20) / PAGESIZE;
 
 // class definition for open files
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufMgr;
+  friend class PageHandle;
+  friend class LogMgr;
 
  public:
-  Status allocatePage(int& pageNo);            // allocate a new page
+  // allocate a new page, if near is given the free page closest to it
+  Status allocatePage(int& pageNo, const int near = -1);
+  // allocate n consecutive new pages at the end of the file; the first
+  // one is returned in firstPageNo
+  const Status allocatePages(const int n, int& firstPageNo);
   const Status disposePage(const int pageNo);  // release space for a page
   const Status readPage(const int pageNo,
                         Page* pagePtr) const;  // read page from file
   const Status writePage(const int pageNo,
                          const Page* pagePtr);   // write page to file
+
+  // read up to n consecutive pages starting at pageNo with a single
+  // system call; nread is set to the number of pages actually read,
+  // which is less than n at the end of the file
+  const Status readPages(const int pageNo, const int n,
+                         Page* pages[], int& nread) const;
+  // write n consecutive pages starting at pageNo with a single system call
+  const Status writePages(const int pageNo, const int n,
+                          const Page* pages[]);
   const Status getFirstPage(int& pageNo) const;  // returns pageNo of first page
+  const Status getFreePages(int& numFree) const;  // returns # of free pages
+
+  // The header page is kept in memory while the file is open and written
+  // back when the file is flushed or closed, or after every n changes if
+  // set here; 0 (the default) waits for the flush.
+  void setHeaderSync(const int n) { hdrSyncEvery = n; }
+  const Status flushHeader() const;  // write the header back if changed
+
+  // Make every page written to the file so far durable, with the header
+  // and the checksums.  Callers that ask while a sync is running wait
+  // for it to end and then share the next one, so one fdatasync commits
+  // everybody who asked in the meantime.
+  const Status sync();
+  long getSyncCount() const { return syncCount; }  // fdatasync rounds so far
+
+  bool isDirect() const { return direct; }  // true if opened for direct I/O
+  bool isMapped() const { return mapBase != NULL; }  // true if mapped read-only
+  bool hasChecksums() const { return sumFile >= 0; }  // true if pages are checksummed
 
   bool operator==(const File& other) const { return fileName == other.fileName; }
 
@@ -38,8 +106,13 @@ class File {
   static const Status create(const string& fileName);
   static const Status destroy(const string& fileName);
 
-  const Status open();
+  // directIO and mapped only count on the first open; a file mapped
+  // read-only cannot be opened for writing as well, nor the other way round
+  const Status open(const bool directIO, const bool mapped, const bool checksums);
+  const Status openMapped();  // first open of a file mapped read-only
+  int closeUnix();            // close the file and its checksums, as close(2)
   const Status close();
+  const Status closeDown();   // the last close, once the pages are out of the pool
 
   const Status intread(const int pageNo,
                        Page* pagePtr) const;  // internal file read
@@ -53,6 +126,87 @@ class File {
   string fileName;  // The name of the file
   int openCnt;      // # times file has been opened
   int unixFile;     // unix file stream for file
+  bool direct;      // opened with O_DIRECT, bypassing the page cache
+  unsigned dioAlign;  // memory alignment direct I/O needs
+
+  bool aligned(const void* p) const;  // p can be transferred without a bounce buffer
+
+  char* mapBase;      // the file mapped read-only, NULL if not mapped
+  int mapPages;       // pages in the mapping
+  std::atomic<int>* mapPins;  // pins of each mapped page, kept by the buffer manager
+
+  // Every page read or written through the file is checksummed with
+  // CRC32C.  The checksums are kept out of the pages, in a file next to
+  // this one (fileName + ".sum"), written back a block at a time on
+  // flush, sync and close.  Before pages are written, their new
+  // checksums go to the file beside their old ones, one write for all
+  // the pages of a write.  The next open settles the pages a crash left
+  // with both: a page keeps the checksum it matches, and a torn page that
+  // matches neither fails when it is read.  In memory a page passes with
+  // its new or its old checksum until its write is done.  0 stands for no checksum, so pages the file had
+  // before it had checksums are read unchecked until they are written.
+  struct PageSums {
+    uint32_t sum;                // checksum of the page
+    uint32_t prev;               // the one it had while a write is not known to be done
+  };
+  int sumFile;                  // file of checksums, -1 if not checksummed
+  mutable std::mutex sumLatch;  // protects sums and sumDirty; taken after hdrLatch
+  vector<PageSums> sums;        // checksums of each page
+  vector<bool> sumDirty;        // block of checksums changed since written
+
+  const Status openSums();      // open, load and settle the checksums
+  const Status staleSums();     // mark the checksums stale for an open without them
+  const Status settleSums();    // settle the pages a crash left with two checksums
+  const Status writeSums();     // write changed checksums back
+  // record the checksums of n pages about to be written
+  const Status sealPages(const int pageNo, const int n, const Page* pages[]);
+  void settlePages(const int pageNo, const int n);  // the n pages were written
+  void growSums(const int pageNo);  // make room for the checksums of a page; sumLatch held
+  void storeSum(const int pageNo, const uint32_t sum);  // sumLatch held
+  // number of the n pages that match their checksums, up to the first that does not
+  int checkPages(const int pageNo, const int n, Page* pages[]) const;
+
+  // the page in the mapping, NULL if beyond it
+  Page* mappedPage(const int pageNo) const {
+    return pageNo >= 1 && pageNo < mapPages ? (Page*)(mapBase + (size_t)pageNo * sizeof(Page)) : NULL;
+  }
+
+  mutable std::mutex hdrLatch;  // serializes updates of the header page
+  mutable DBPage header;        // the header page, while the file is open
+  mutable bool hdrDirty;        // header changed since it was written
+  int hdrChanges;               // header changes since it was written
+  int hdrSyncEvery;             // write the header after this many changes, 0 to wait
+
+  const Status headerChanged();  // note a change, write back at the sync point
+  const Status writeHeader();    // write changed bitmap pages and the header
+
+  vector<uint64_t> freeBits;    // the bitmap pages, while the file is open
+  vector<bool> mapDirty;        // bitmap page changed since it was written
+  int freeHint;                 // no free page in the words of freeBits before this
+
+  const Status readFreeMaps();  // load the bitmaps, converting a legacy free list
+  const Status setFree(const int pageNo);  // mark a page free; hdrLatch held
+  void takeFree(const int pageNo);         // mark a free page in use; hdrLatch held
+  int findFree(const int near) const;      // the free page closest to near, -1 if none
+
+  int reserved;                 // pages the file system has reserved space for
+  bool canReserve;              // false once fallocate turned out to be unsupported
+  const Status extend(const int n);  // grow the file by n pages; hdrLatch held
+
+  std::mutex syncLatch;         // protects the sync state below
+  std::condition_variable syncDone;  // signalled when a sync ends
+  bool syncing;                 // a sync is running
+  uint64_t syncAsked;           // syncs asked for so far
+  uint64_t syncCovered;         // syncs asked for before the last sync that succeeded began
+  long syncCount;               // syncs done
+
+  std::atomic<LogMgr*> log;     // write-ahead log holding pages of the file, NULL if none
+  // redo a page image or a disposal found in the log, allocating the
+  // page first if the file does not have it in use
+  const Status restorePage(const int pageNo, const Page* pagePtr);
+  const Status restoreDispose(const int pageNo);
+
+  BufFileState* bufState;       // buffer manager state for this file
 };
 
 class BufMgr;
@@ -97,18 +251,30 @@ class DB {
   const Status destroyFile(const string& fileName);            // destroy a file,
                                                                // release all space
   const Status openFile(const string& fileName, File*& file);  // open a file
-  const Status closeFile(File* file);                          // close a file
+
+  // Open a file mapped read-only.  The buffer manager hands out pointers
+  // into the mapping instead of copying pages into the pool; pages cannot
+  // be written, allocated or disposed of (FILEREADONLY).
+  const Status openFile(const string& fileName, File*& file, const bool mapped);
+
+  // Files this DB opens from now on are checksummed (the default) or not.
+  // A file opened without checksums keeps those it had; the pages written
+  // meanwhile lose theirs when it is next opened with checksums.
+  void setChecksums(const bool on) { checksums = on; }
+  // close a file; PAGEPINNED, and the file stays open, while any of its
+  // pages is pinned
+  const Status closeFile(File* file);
+
+  // Files this DB opens from now on bypass the kernel page cache with
+  // O_DIRECT, so that pages are cached only in the buffer pool.  Where the
+  // file system does not support it, or needs a larger alignment than a
+  // page, files are opened for buffered I/O as before.
+  void setDirectIO(const bool on) { directIO = on; }
 
  private:
   OpenFileHashTbl openFiles;  // list of open files
+  bool directIO;              // open files with O_DIRECT
+  bool checksums;             // checksum the pages of files
 };
 
-// structure of DB (header) page
-
-typedef struct {
-  int nextFree;   // page # of next page on free list
-  int firstPage;  // page # of first page in file
-  int numPages;   // total # of pages in file
-} DBPage;
-
 #endif
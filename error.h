@@ -17,7 +17,8 @@ enum Status {
 // File and DB errors
 
        BADFILEPTR, BADFILE, FILETABFULL, FILEOPEN, FILENOTOPEN,
-       UNIXERR, BADPAGEPTR, BADPAGENO, FILEEXISTS,
+       UNIXERR, BADPAGEPTR, BADPAGENO, FILEEXISTS, FILEREADONLY,
+       BADCHECKSUM, BADLOG,
 
 // BufMgr and HashTable errors
 
@@ -27,6 +28,7 @@ enum Status {
 // Page errors
 	
        NOSPACE,  NORECORDS,  ENDOFPAGE, INVALIDSLOTNO, INVALIDRECLEN,
+       RECFORWARDED,
 
 // HeapFile errors
 
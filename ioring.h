@@ -0,0 +1,68 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include "error.h"
+
+// one vectored read or write of a batch
+struct IoReq {
+  int fd;                    // file descriptor
+  bool write;                // write if true, read otherwise
+  off_t offset;              // offset in the file
+  const struct iovec* iov;   // buffers
+  int iovcnt;                // number of buffers
+  int result;                // bytes transferred or -errno, set on completion
+  bool done;                 // set on completion
+};
+
+// A minimal io_uring instance, set up with raw system calls.  Any number
+// of threads may submit batches through the same ring; the requests of
+// all of them are in flight together and run() returns once every request
+// of its own batch has completed.  One waiting thread at a time reaps
+// completions on behalf of all of them.
+class IoRing {
+ public:
+  IoRing();
+  ~IoRing();
+
+  // set up a ring of at least the given depth; UNIXERR if the kernel
+  // has no io_uring or does not allow it
+  const Status init(const unsigned depth);
+
+  // submit n requests and wait until all of them have completed; the
+  // outcome of each request is in its result field
+  const Status run(IoReq reqs[], const int n);
+
+ private:
+  int ringFd;          // io_uring file descriptor, -1 if not set up
+  unsigned entries;    // submission queue entries
+
+  // submission queue, shared with the kernel
+  void* sqRing;
+  size_t sqRingSize;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  struct io_uring_sqe* sqes;
+  size_t sqesSize;
+
+  // completion queue, shared with the kernel
+  void* cqRing;
+  size_t cqRingSize;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  struct io_uring_cqe* cqes;
+
+  unsigned inflight;   // requests submitted and not reaped yet
+  std::mutex sqLatch;  // protects the submission queue and inflight
+  std::mutex cqLatch;  // held by the thread reaping completions
+
+  int submit(IoReq reqs[], const int n);  // queue up to n requests, returns how many
+  void reap(const bool wait);  // collect completions, waiting for one if asked; cqLatch held
+};
+
+#endif
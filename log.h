@@ -0,0 +1,99 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "db.h"
+
+class BufMgr;
+
+// no log record; the recLSN of a clean frame
+const uint64_t NOLSN = UINT64_MAX;
+
+// the log starts with a header block; records follow it
+const int LOGHEADER = 4096;
+
+// the log is flushed once this many bytes are buffered
+const size_t LOGBUFSIZE = 1 << 20;
+
+// Write-ahead log of page images.  With a log attached, the buffer
+// manager appends the full image of a page when the last pin of it goes
+// after any of the pins changed it, and a record of every page disposed
+// of.  Records go to an
+// in-memory buffer and reach the disk sequentially when the log is
+// flushed; a page is never written to its file before the log is durable
+// up to its last record.  A log sequence number (LSN) is the offset of a
+// record in the log file.
+//
+// Opening the log redoes the records found since the last checkpoint:
+// the images are written into their files, which are extended, or have
+// pages taken off the free bitmaps, as needed, and the disposed pages are
+// disposed of again.  A checkpoint writes the dirty pages of the pool out
+// and lets the log forget what was logged before the oldest page still
+// dirty.  Records name their file, so a file should not be destroyed and
+// created again without a checkpoint in between.
+class LogMgr {
+  friend class File;
+
+ public:
+  LogMgr();
+  ~LogMgr();  // closes the log, without flushing it
+
+  // Open the log, creating it if needed, and redo its records into the
+  // files, which are opened through db; to be called before any of the
+  // files is opened.  The log starts out empty.  BADLOG if the file is
+  // not a log.
+  const Status open(DB& db, const std::string& logName);
+
+  // append the image of page pageNo of file; start and end are the
+  // LSNs of the record and of the byte after it
+  const Status logPage(File* file, const int pageNo, const Page* page, uint64_t& start, uint64_t& end);
+  // append a record of disposing of page pageNo of file
+  const Status logDispose(File* file, const int pageNo);
+
+  // Make the log durable up to lsn.  Callers that ask while a flush is
+  // running wait for it and then share the next one, so one write and
+  // fdatasync commits everybody who asked in the meantime.
+  const Status flush(const uint64_t lsn);
+  const Status commit();  // make everything logged so far durable
+  // flush the log if its buffer is full; called by the buffer manager
+  // after logging, once its latches are released
+  const Status spill();
+
+  // write out the dirty pages of mgr, sync the files and move the start of
+  // the log past the records no longer needed; their space is released
+  const Status checkpoint(BufMgr* mgr);
+
+  uint64_t getEnd();           // LSN of the next record
+  long getRecords() const { return records; }    // records appended
+  long getFlushes() const { return flushes; }    // writes of the log, each with an fdatasync
+  long getRedone() const { return redone; }      // records redone by open
+
+ private:
+  int logFile;                 // the log file, -1 if not open
+  std::mutex latch;            // protects everything below
+  std::condition_variable flushDone;  // signalled when a flush ends
+  std::vector<char> buffer;    // records not written yet
+  std::vector<char> spare;     // the buffer being written by a flush
+  uint64_t bufferStart;        // LSN of the first byte of buffer
+  uint64_t durable;            // the log is durable up to here
+  bool flushing;               // a flush is running
+  bool broken;                 // a write failed; nothing can be logged any more
+  long records, flushes, redone;
+
+  std::mutex filesLatch;       // protects files; taken before any File latch
+  std::set<File*> files;       // open files with pages in the log
+
+  // append a record of the given kind; page is NULL but for page images
+  const Status append(File* file, const int kind, const int pageNo, const Page* page,
+                      uint64_t& start, uint64_t& end);
+  const Status writeHeader(const uint64_t redo);  // record where redo starts
+  const Status redo(DB& db, const uint64_t from);  // redo the records from an LSN
+  void forget(File* file);     // the file is closing and was synced
+};
+
+#endif
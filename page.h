@@ -3,6 +3,7 @@
 
 #include "error.h"
 #include "string.h"
+#include <stddef.h>
 
 struct RID{
     int  pageNo;
@@ -17,35 +18,83 @@ struct Record
   int length;
 };
 
+// a record as a scan of a page yields it, read-only
+struct PageRecord
+{
+  RID rid;
+  const char* data;
+  int length;
+};
+
 // slot structure
 struct slot_t {
-        short	offset;  
+        short	offset;  // of a free slot: link to the next free slot
         short	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
+// The length of a slot holding a forwarding stub: the record grew too
+// big for its page and lives at the RID stored where it used to be.
+const short FORWARDSTUB = -2;
+
+// Free slots are chained through their offsets, with freeSlot in the
+// page header as the head, so that inserts find one without a scan.  A
+// link to slot i is 1 - i; NOFREESLOT ends the chain.  Pages written
+// before the chain existed hold 0 in freeSlot, which init did not set,
+// and 0 in the offsets of free slots.  A head or link that does not lead
+// to a free slot makes the next insert rebuild the chain from the slots.
+const short NOFREESLOT = -1;
+
+// The page size is chosen when building, with -DPAGEKB=n for pages of
+// n KB, n being 1 (the default), 2, 4, 8, 16 or 32; pages, the buffer
+// pool and files all have that one size.  Files written with one page
+// size cannot be read with another.
+
+#ifndef PAGEKB
+#define PAGEKB 1
+#endif
+
+const unsigned PAGESIZE = PAGEKB * 1024;
 const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
 
 // Class definition for a minirel data page.   
-// The design assumes that records are kept compacted when
-// deletions are performed. Notice, however, that the slot
+// Deleting a record leaves a hole in data[], counted in freeSpace;
+// the records are compacted only when an insert needs the holes, or
+// by compact(). Notice, however, that the slot
 // array cannot be compacted.  Notice, this class does not keep
 // the records align, relying instead on upper levels to take
 // care of non-aligned attributes
 
 class Page {
+    static_assert(PAGESIZE - DPFIXED <= 32767, "slot offsets and lengths are shorts");
+
 private:
     char 	data[PAGESIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
     short	slotCnt; // number of slots in use;
     short	freePtr; // offset of first free byte in data[]
-    short	freeSpace; // number of bytes free in data[]
-    short	dummy;	// for alignment purposes
+    short	freeSpace; // number of bytes free in data[], holes included
+    short	freeSlot; // head of the chain of free slots
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
 
+    // Slot i, for i from 0 down to slotCnt + 1.  Reached from the start
+    // of the page, as the bound of slot[] would let an optimizing
+    // compiler assume that i is 0.
+    slot_t& slotAt(const int i)
+	{ return ((slot_t*)((char*)this + offsetof(Page, slot)))[i]; }
+    const slot_t& slotAt(const int i) const
+	{ return ((const slot_t*)((const char*)this + offsetof(Page, slot)))[i]; }
+
+    bool freeLink(const int link) const;  // link leads to a free slot or ends the chain
+    void rebuildFreeSlots();  // chain up all the free slots
+    int takeFreeSlot();       // unchain a free slot, slotCnt if none
+    int contiguousSpace() const;  // bytes between freePtr and the slot array
+    int bytesOf(const int i) const;  // bytes of data[] slot i takes up
+    // put length bytes in place of what slot i holds
+    const Status replace(const int i, const void* bytes, const int length);
+
 public:
     void init(const int pageNo); // initialize a new page
     void dumpPage() const;       // dump contents of a page
@@ -57,9 +106,32 @@ public:
     // inserts a new record (rec) into the page, returns RID of record 
     const Status insertRecord(const Record & rec, RID& rid);
 
+    // Insert recs[0] to recs[n - 1], or as many of them as fit, in
+    // order; returns how many, their RIDs in rids.  A record of no length
+    // stops the batch there.  The records are laid out one after the
+    // other, compacting the page at most once.
+    int insertRecords(const Record* recs, const int n, RID* rids);
+
     // delete the record with the specified rid
     const Status deleteRecord(const RID & rid);
 
+    // Replace the record with rid by rec: in place if rec is no longer,
+    // else moved to the free space of the page.  NOSPACE if it does not
+    // fit on the page; the caller may then insert it on another page and
+    // forward the RID there.  Updating a forwarding stub brings the
+    // record home, and the copy it pointed to is the caller's to delete.
+    const Status updateRecord(const RID & rid, const Record & rec);
+
+    // Replace the record with rid by a stub forwarding to the RID to,
+    // so that rid stays valid.  Scans still return rid, for which
+    // getRecord returns RECFORWARDED and getForward gives to; deleting
+    // rid deletes only the stub.  NOSPACE if even the stub does not fit.
+    const Status forwardRecord(const RID & rid, const RID & to);
+    const Status getForward(const RID & rid, RID & to) const;
+
+    // close up the holes left by deleted records; RIDs do not change
+    void compact();
+
     // returns RID of first record on page
     // returns  NORECORDS if page contains no records.  Otherwise, returns OK
     const Status firstRecord(RID& firstRid) const;
@@ -69,7 +141,27 @@ public:
     const Status nextRecord (const RID & curRid, RID& nextRid) const;
 
     // returns reference to record with RID rid
+    // returns RECFORWARDED if rid holds a forwarding stub
     const Status getRecord(const RID & rid, Record & rec);
+    const Status getRecord(const RID & rid, PageRecord & rec) const;
+
+    // Iterates over the records of the page in slot order, straight off
+    // the slot array, skipping free slots and forwarding stubs:
+    //   for (const PageRecord& rec : page) ...
+    // The page must not change during the scan.
+    class iterator {
+	const Page* page;
+	int i;  // current slot
+	void skip() { while (i > page->slotCnt && page->slotAt(i).length < 0) i--; }
+    public:
+	iterator(const Page* page, const int i) : page(page), i(i) { skip(); }
+	PageRecord operator*() const
+	    { return {{page->curPage, -i}, &page->data[page->slotAt(i).offset], page->slotAt(i).length}; }
+	iterator& operator++() { i--; skip(); return *this; }
+	bool operator!=(const iterator& other) const { return i != other.i; }
+    };
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, slotCnt); }
 };
 
 #endif